@@ -18,24 +18,41 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
 #include <linux/fb.h>
 #include <linux/input.h>
 #include <linux/uinput.h>
 #include <linux/vt.h>
+#ifndef NO_FREETYPE
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_SIZES_H
+#elif !defined(BAKED_FONT)
+#error "NO_FREETYPE needs BAKED_FONT"
+#endif
 
 volatile sig_atomic_t done = 0;
 
+#ifdef BAKED_FONT
+char *font = NULL;	// the baked font is used unless -f is given
+#else
 char *font = "/usr/share/fonts/ttf-dejavu/DejaVuSans.ttf";
+#endif
 char *device = NULL;
+char *config = NULL;
+int privateuinput = 0;	// one uinput device per seat instead of a shared one
+int overlay = 0;	// blend the keyboard over the console instead of shrinking it
 char *special[][7] = {
 	{ "Esc", "Tab", "F10", " / ", " - ", " . ", " \\ " },
 	{ "Esc", "Tab", "F10", " ? ", " _ ", " > ", " | " },
@@ -48,9 +65,6 @@ char *layout[] = {
 	"!@#$%^&*()_+{}:\"|<>~?     "
 };
 
-int layoutuse = 0;
-int ctrllock = 0;
-int altlock = 0;
 __u16 keys[][26] = {
 	{ KEY_ESC, KEY_TAB, KEY_F10, KEY_SLASH, KEY_MINUS, KEY_DOT, KEY_BACKSLASH },
 	{ KEY_Q, KEY_W, KEY_E, KEY_R, KEY_T, KEY_Y, KEY_U, KEY_I, KEY_O, KEY_P,
@@ -67,230 +81,402 @@ __u16 keys[][26] = {
 	  KEY_RIGHTSHIFT }
 };
 
-#define TOUCHCOLOR 0x4444ee
-#define BUTTONCOLOR 0x111122
-#define BACKLITCOLOR 0xff0000
-#define TERMCOLOR 0x000000
+/*
+ * The top byte is the opacity used in overlay mode, it is cleared
+ * before drawing otherwise.
+ */
+#define TOUCHCOLOR 0xe04444ee
+#define BUTTONCOLOR 0xc0111122
+#define BACKLITCOLOR 0xffff0000
+#define TERMCOLOR 0x00000000
 int gap = 2;
 
+#define WATCH_INTERVAL 100	// ms between two damage checks
+#define WATCH_SLICES 8	// damage checks for one pass over the keyboard
+#define WATCH_STRIDE 4	// of lines compared in a band of tiles
+#define TILE_LINES 16
+#define TILE_PIXELS 64
+
 int rotate = 0;
 
-struct fb_var_screeninfo vinfo;
-struct fb_fix_screeninfo finfo;
-char *buf;
-unsigned int buflen;
-int fbheight;	// of framebuffer
-int fbwidth;	// of framebuffer
-int fblinelength;	// of one line of framebuffer
-int height;	// of one row of keys
-int width;	// of keyboard (= width of screen)
-int linelength;	// of one line of keyboard shape in bytes
-int landscape;	// false = portrait
+/*
+ * Glyphs are rendered upright once per pixel size and rotated while
+ * drawing, so every seat using the same size shares one cache.
+ */
+struct glyph {
+	int left;	// from the pen position to the bitmap
+	int top;	// from the baseline to the bitmap
+	int advance;	// offset to the next glyph
+	int width;
+	int rows;
+	const unsigned char *bitmap;
+};
+
+struct fontsize {
+	int pixels;
+	int ascender;
+	struct glyph glyphs[128];
+#ifndef NO_FREETYPE
+	FT_Size size;
+#endif
+	struct fontsize *next;
+};
 
+#ifndef NO_FREETYPE
+FT_Library library;
 FT_Face face;
-int advance;	// offset to the next glyph
+#endif
+struct fontsize *fontsizes;
 
-int fduinput;
-struct input_event ie;
-int theight;	// of touchscreen
-int twidth;	// of touchscreen
-int trowh;	// heigth of one keyboard row on touchscreen
+#ifdef BAKED_FONT
+/*
+ * Generated by mkfont, see the Makefile. Defines the constant
+ * bakedsizes[], the label glyphs pre-rasterized at several pixel sizes.
+ */
+#include "bakedfont.h"
 
-void fill_rect(int x, int y, int w, int h, int color)
+const struct fontsize *nearest_bakedsize(int pixels)
 {
-	int i, j, t;
-	int32_t *line;
-	switch (rotate) {
+	const struct fontsize *fs, *best = &bakedsizes[0];
+
+	for (fs = bakedsizes; fs < bakedsizes + sizeof(bakedsizes) / sizeof(bakedsizes[0]); fs++)
+		if (abs(fs->pixels - pixels) < abs(best->pixels - pixels))
+			best = fs;
+	return best;
+}
+#endif
+
+/*
+ * A uinput device, shared by all seats unless -u is given. It tracks
+ * the modifiers it holds down, so that every seat sends its keys with
+ * its own Shift, Alt and Ctrl locks.
+ */
+struct uinputdev {
+	int fd;
+	int shift;
+	int alt;
+	int ctrl;
+};
+
+/*
+ * One framebuffer together with the touchscreen on top of it.
+ */
+struct seat {
+	char *fbdev;
+	char *inputdev;
+	int rotate;
+
+	int fbfd;
+	struct fb_var_screeninfo vinfo;
+	struct fb_fix_screeninfo finfo;
+	char *buf;
+	unsigned int buflen;
+	int fbheight;	// of framebuffer
+	int fbwidth;	// of framebuffer
+	int fblinelength;	// of one line of framebuffer
+	int height;	// of one row of keys
+	int width;	// of keyboard (= width of screen)
+	int depth;	// of keyboard shape including the overlay handle
+	int top;	// of the first row of keys
+	int handleh;	// of overlay handle
+	int linelength;	// of one line of keyboard shape in bytes
+	int buflines;	// of keyboard shape in buf
+	int landscape;	// false = portrait
+	const struct fontsize *font;
+
+	int hidden;	// overlay folded away to its handle
+	char *bg;	// console content below the overlay
+	char *shown;	// keyboard as last blended into out
+	char *out;	// overlay as last written to the framebuffer
+	char *line;	// one line read back from the framebuffer
+	char *damaged;	// tiles of the band being checked
+	int watchband;	// next band of tiles to check for damage
+	int watchphase;	// line in the bands compared on this pass
+
+	int fdinput;
+	int tscore;	// rank of the touchscreen found without -d
+	struct uinputdev *uinput;
+	int theight;	// of touchscreen
+	int twidth;	// of touchscreen
+	int trowh;	// heigth of one keyboard row on touchscreen
+	int thandleh;	// heigth of overlay handle on touchscreen
+	int absolute_x;	// of the touch being read, -1 if not yet known
+	int absolute_y;
+	int released;
+	int key;
+
+	int layoutuse;
+	int ctrllock;
+	int altlock;
+	int row;
+	int pressed;
+};
+
+struct seat *seats;
+int nseats;
+
+const struct fontsize *load_fontsize(int pixels)
+{
+#ifdef NO_FREETYPE
+	return nearest_bakedsize(pixels);
+#else
+	struct fontsize *fs;
+	struct glyph *g;
+	unsigned char *bitmap;
+	int c, i;
+
+#ifdef BAKED_FONT
+	if (font == NULL)
+		return nearest_bakedsize(pixels);
+#endif
+	for (fs = fontsizes; fs; fs = fs->next)
+		if (fs->pixels == pixels)
+			return fs;
+
+	fs = calloc(1, sizeof(*fs));
+	if (fs == NULL) {
+		perror("malloc failed");
+		exit(-1);
+	}
+	fs->pixels = pixels;
+	if (FT_New_Size(face, &fs->size) || FT_Activate_Size(fs->size)) {
+		perror("FT_New_Size failed");
+		exit(-1);
+	}
+	if (FT_Set_Pixel_Sizes(face, pixels, pixels)) {
+		perror("FT_Set_Pixel_Sizes failed");
+		exit(-1);
+	}
+	fs->ascender = face->size->metrics.ascender >> 6;
+	for (c = ' '; c < 127; c++) {
+		if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+			continue;
+		g = &fs->glyphs[c];
+		g->left = face->glyph->bitmap_left;
+		g->top = face->glyph->bitmap_top;
+		g->advance = face->glyph->advance.x >> 6;
+		g->width = face->glyph->bitmap.width;
+		g->rows = face->glyph->bitmap.rows;
+		bitmap = malloc(g->width * g->rows);
+		if (bitmap == NULL) {
+			perror("malloc failed");
+			exit(-1);
+		}
+		for (i = 0; i < g->rows; i++)
+			memcpy(bitmap + g->width * i,
+			       face->glyph->bitmap.buffer + face->glyph->bitmap.pitch * i,
+			       g->width);
+		g->bitmap = bitmap;
+	}
+	fs->next = fontsizes;
+	fontsizes = fs;
+	return fs;
+#endif
+}
+
+/*
+ * Returns the offset in the keyboard buffer of the pixel at x, y.
+ */
+int pixel_offset(struct seat *s, int x, int y)
+{
+	int t;
+	switch (s->rotate) {
 		case FB_ROTATE_UR:
 			break;
 		case FB_ROTATE_UD:
-			x = width - x - w;
-			y = (height * 5) - y - h;
+			x = s->width - x - 1;
+			y = s->depth - y - 1;
 			break;
 		case FB_ROTATE_CW:
-			y = (height * 5) - y - h;
-			t = w; w = h; h = t;
-			t = x; x = y; y = t;
+			t = x;
+			x = s->depth - y - 1;
+			y = t;
 			break;
 		case FB_ROTATE_CCW:
-			x = width - x - w;
-			t = w; w = h; h = t;
-			t = x; x = y; y = t;
+			t = x;
+			x = y;
+			y = s->width - t - 1;
 			break;
 	}
-	for (i = 0; i < h; i++) {
-		line = (int32_t *) (buf + linelength * (y + i));
-		for (j = 0; j < w; j++) {
-			*(line + x + j) = color;
-		}
-	}
+	return s->linelength * y + x * 4;
 }
 
-void draw_char(int x, int y, char c)
+void fill_rect(struct seat *s, int x, int y, int w, int h, int color)
 {
 	int i, j, t;
-	int color;
-	FT_Matrix matrix;
-	switch (rotate) {
+	int32_t *line;
+	switch (s->rotate) {
 		case FB_ROTATE_UR:
-			FT_Load_Char(face, c, FT_LOAD_RENDER);
-			x += face->glyph->bitmap_left;
-			y += (face->size->metrics.ascender >> 6) - face->glyph->bitmap_top;
-			advance = face->glyph->advance.x >> 6;
 			break;
 		case FB_ROTATE_UD:
-			matrix.xx = (FT_Fixed)(-1 * 0x10000L);
-			matrix.xy = (FT_Fixed)(0);
-			matrix.yx = (FT_Fixed)(0);
-			matrix.yy = (FT_Fixed)(-1 * 0x10000L);
-			FT_Set_Transform(face, &matrix, NULL);
-			FT_Load_Char(face, c, FT_LOAD_RENDER);
-			x = width - x;
-			y = (height * 5) - y;
-			x += (face->glyph->advance.x >> 6) - face->glyph->bitmap.width - face->glyph->bitmap_left;
-			y -= (face->size->metrics.ascender >> 6) + face->glyph->bitmap_top;
-			advance = -(face->glyph->advance.x >> 6);
+			x = s->width - x - w;
+			y = s->depth - y - h;
 			break;
 		case FB_ROTATE_CW:
-			matrix.xx = (FT_Fixed)(0);
-			matrix.xy = (FT_Fixed)( 1 * 0x10000L);
-			matrix.yx = (FT_Fixed)(-1 * 0x10000L);
-			matrix.yy = (FT_Fixed)(0);
-			FT_Set_Transform(face, &matrix, NULL);
-			FT_Load_Char(face, c, FT_LOAD_RENDER);
-			y = (height * 5) - y;
-			x -= face->glyph->bitmap_top;
-			y += face->glyph->bitmap_left - (face->size->metrics.ascender >> 6);
+			y = s->depth - y - h;
+			t = w; w = h; h = t;
 			t = x; x = y; y = t;
-			advance = -(face->glyph->advance.y >> 6);
 			break;
 		case FB_ROTATE_CCW:
-			matrix.xx = (FT_Fixed)(0);
-			matrix.xy = (FT_Fixed)(-1 * 0x10000L);
-			matrix.yx = (FT_Fixed)( 1 * 0x10000L);
-			matrix.yy = (FT_Fixed)(0);
-			FT_Set_Transform(face, &matrix, NULL);
-			FT_Load_Char(face, c, FT_LOAD_RENDER);
-			x = width - x;
-			x -= face->glyph->bitmap_top;
-			y += face->glyph->bitmap_left + (face->size->metrics.ascender >> 6);
+			x = s->width - x - w;
+			t = w; w = h; h = t;
 			t = x; x = y; y = t;
-			advance = face->glyph->advance.y >> 6;
 			break;
 	}
-	for (i = 0; i < (face->glyph->bitmap.rows); i++)
-		for (j = 0; j < face->glyph->bitmap.width; j++) {
-			color =
-			    *(face->glyph->bitmap.buffer +
-			      face->glyph->bitmap.pitch * i + j);
+	if (!overlay)
+		color &= 0xffffff;
+	for (i = 0; i < h; i++) {
+		line = (int32_t *) (s->buf + s->linelength * (y + i));
+		for (j = 0; j < w; j++) {
+			*(line + x + j) = color;
+		}
+	}
+}
+
+/*
+ * Returns the offset to the next glyph.
+ */
+int draw_char(struct seat *s, int x, int y, char c)
+{
+	int i, j;
+	int color;
+	char *p;
+	const struct glyph *g = &s->font->glyphs[c & 0x7f];
+
+	x += g->left;
+	y += s->font->ascender - g->top;
+	for (i = 0; i < g->rows; i++)
+		for (j = 0; j < g->width; j++) {
+			color = *(g->bitmap + g->width * i + j);
 			if (color) {
-				*(buf + linelength * (i + y) +
-				  (j + x) * 4) = color;
-				*(buf + linelength * (i + y) +
-				  (j + x) * 4 + 1) = color;
-				*(buf + linelength * (i + y) +
-				  (j + x) * 4 + 2) = color;
+				p = s->buf + pixel_offset(s, x + j, y + i);
+				*p = color;
+				*(p + 1) = color;
+				*(p + 2) = color;
+				if (overlay)
+					*(p + 3) = 0xff;
 			}
 		}
+	return g->advance;
 }
 
-void draw_text(int x, int y, char *text)
+void draw_text(struct seat *s, int x, int y, char *text)
 {
 	while (*text) {
-		draw_char(x, y, *text);
+		x += draw_char(s, x, y, *text);
 		text++;
-		x += advance;
 	}
 }
 
-void draw_key(int x, int y, int w, int h, int color)
+void draw_key(struct seat *s, int x, int y, int w, int h, int color)
 {
-	fill_rect(x + gap, y + gap, w - 2 * gap, 1, BACKLITCOLOR);
-	fill_rect(x + gap, y + h - gap, w - 2 * gap, 1, BACKLITCOLOR);
-	fill_rect(x + gap, y + gap, 1, h - 2 * gap, BACKLITCOLOR);
-	fill_rect(x + w - gap, y + gap, 1, h - 2 * gap, BACKLITCOLOR);
-	fill_rect(x + gap + 1, y + gap + 1, w - 2 * gap - 2,
+	fill_rect(s, x + gap, y + gap, w - 2 * gap, 1, BACKLITCOLOR);
+	fill_rect(s, x + gap, y + h - gap, w - 2 * gap, 1, BACKLITCOLOR);
+	fill_rect(s, x + gap, y + gap, 1, h - 2 * gap, BACKLITCOLOR);
+	fill_rect(s, x + w - gap, y + gap, 1, h - 2 * gap, BACKLITCOLOR);
+	fill_rect(s, x + gap + 1, y + gap + 1, w - 2 * gap - 2,
 		  h - 2 * gap - 2, color);
 }
 
-void draw_textbutton(int x, int y, int w, int h, int color, char *text)
+void draw_textbutton(struct seat *s, int x, int y, int w, int h, int color, char *text)
 {
-	draw_key(x, y, w, h, color);
-	draw_text(x + gap + 14, y + gap + 24, text);
+	draw_key(s, x, y, w, h, color);
+	draw_text(s, x + gap + 14, y + gap + 24, text);
 }
 
-void draw_button(int x, int y, int w, int h, int color, char chr)
+void draw_button(struct seat *s, int x, int y, int w, int h, int color, char chr)
 {
-	draw_key(x, y, w, h, color);
-	draw_char(x + gap + 7, y + gap + 7, chr);
+	draw_key(s, x, y, w, h, color);
+	draw_char(s, x + gap + 7, y + gap + 7, chr);
 }
 
-void draw_keyboard(int row, int pressed)
+/*
+ * The handle folds the overlay away and brings it back.
+ */
+void draw_handle(struct seat *s, int y)
+{
+	draw_key(s, s->width * 17 / 20, y, s->width * 3 / 20 - 1, s->handleh,
+		 (s->pressed == 98) ? TOUCHCOLOR : BUTTONCOLOR);
+}
+
+void draw_keyboard(struct seat *s)
 {
 	int key;
+	int width = s->width, height = s->height;
+	int row = s->row, pressed = s->pressed;
+	int top = s->top;
+
+	if (overlay) {
+		fill_rect(s, 0, 0, width, s->depth, TERMCOLOR);
+		if (s->hidden) {
+			draw_handle(s, s->depth - s->handleh);
+			return;
+		}
+		draw_handle(s, 0);
+	}
 	for (key = 0; key < 7; key++) {
-		draw_textbutton(key * width / 7 + 1, 1,
+		draw_textbutton(s, key * width / 7 + 1, top + 1,
 				width / 7 - 1, height - 1,
 				(row == 0
 				 && key ==
 				 pressed) ? TOUCHCOLOR :
 				BUTTONCOLOR,
-				special[layoutuse & 1][key]);
+				special[s->layoutuse & 1][key]);
 	}
 	for (key = 0; key < 10; key++) {
-		draw_button(key * width / 10 + 1, height * 1,
+		draw_button(s, key * width / 10 + 1, top + height * 1,
 			    width / 10 - 1, height - 1,
 			    (row == 1
 			     && key ==
 			     pressed) ? TOUCHCOLOR : BUTTONCOLOR,
-			    layout[layoutuse][key]);
+			    layout[s->layoutuse][key]);
 	}
 	for (key = 0; key < 9; key++) {
-		draw_button(width / 20 +
-			    key * width / 10, height * 2,
+		draw_button(s, width / 20 +
+			    key * width / 10, top + height * 2,
 			    width / 10 - 1, height - 1,
 			    (row == 1
 			     && key + 10 ==
 			     pressed) ? TOUCHCOLOR : BUTTONCOLOR,
-			    layout[layoutuse][key + 10]);
+			    layout[s->layoutuse][key + 10]);
 	}
-	draw_textbutton(1, height * 3, width * 3 / 20 - 1,
+	draw_textbutton(s, 1, top + height * 3, width * 3 / 20 - 1,
 			height - 1,
-			(layoutuse & 1) ? TOUCHCOLOR : BUTTONCOLOR,
+			(s->layoutuse & 1) ? TOUCHCOLOR : BUTTONCOLOR,
 			"Shift");
 	for (key = 0; key < 7; key++) {
-		draw_button(width * 3 / 20 +
-			    key * width / 10, height * 3,
+		draw_button(s, width * 3 / 20 +
+			    key * width / 10, top + height * 3,
 			    width / 10 - 1, height - 1,
 			    (row == 1
 			     && key + 19 ==
 			     pressed) ? TOUCHCOLOR : BUTTONCOLOR,
-			    layout[layoutuse][key + 19]);
+			    layout[s->layoutuse][key + 19]);
 	}
-	draw_textbutton(width * 17 / 20, height * 3,
+	draw_textbutton(s, width * 17 / 20, top + height * 3,
 			width * 3 / 20 - 1, height - 1,
 			(row == 3
 		 && 1 ==
 			 pressed) ? TOUCHCOLOR : BUTTONCOLOR,
 			"Bcksp");
-	draw_textbutton(1, height * 4, width * 3 / 20 - 1,
+	draw_textbutton(s, 1, top + height * 4, width * 3 / 20 - 1,
 			height - 1,
 			(99 == pressed) ? TOUCHCOLOR : BUTTONCOLOR,
-			(layoutuse & 2) ? "abcABC" : "123!@\"");
-	draw_textbutton(width * 3 / 20, height * 4,
+			(s->layoutuse & 2) ? "abcABC" : "123!@\"");
+	draw_textbutton(s, width * 3 / 20, top + height * 4,
 			width / 10 - 1, height - 1,
-			(altlock) ? TOUCHCOLOR : BUTTONCOLOR,
+			(s->altlock) ? TOUCHCOLOR : BUTTONCOLOR,
 			"Alt");
-	draw_button(width / 4, height * 4, width / 2 - 1,
+	draw_button(s, width / 4, top + height * 4, width / 2 - 1,
 		    height - 1, (row == 4
 				&& 1 ==
 				pressed) ? TOUCHCOLOR :
 		    BUTTONCOLOR, ' ');
-	draw_textbutton(width * 3 / 4, height * 4,
+	draw_textbutton(s, width * 3 / 4, top + height * 4,
 			width / 10 - 1, height - 1,
-			(ctrllock) ? TOUCHCOLOR : BUTTONCOLOR,
+			(s->ctrllock) ? TOUCHCOLOR : BUTTONCOLOR,
 			"Ctrl");
-	draw_textbutton(width * 17 / 20, height * 4,
+	draw_textbutton(s, width * 17 / 20, top + height * 4,
 			width * 3 / 20 - 1, height - 1,
 			(row == 4
 			 && 3 ==
@@ -298,91 +484,324 @@ void draw_keyboard(int row, int pressed)
 			"Enter");
 }
 
-void show_fbkeyboard(int fbfd)
+void show_fbkeyboard(struct seat *s)
 {
-	switch (rotate) {
+	switch (s->rotate) {
 		case FB_ROTATE_UR:
-			lseek(fbfd, fblinelength * (fbheight - height * 5), SEEK_SET);
-			write(fbfd, buf, buflen);
+			lseek(s->fbfd, s->fblinelength * (s->fbheight - s->depth), SEEK_SET);
+			write(s->fbfd, s->buf, s->buflen);
 			break;
 		case FB_ROTATE_UD:
-			lseek(fbfd, 0, SEEK_SET);
-			write(fbfd, buf, buflen);
+			lseek(s->fbfd, 0, SEEK_SET);
+			write(s->fbfd, s->buf, s->buflen);
 			break;
 		case FB_ROTATE_CW:
-			for (int i = 0; i < width; i++) {
-				lseek(fbfd, fblinelength * i, SEEK_SET);
-				write(fbfd, (int32_t *) (buf + linelength * i), linelength);
+			for (int i = 0; i < s->width; i++) {
+				lseek(s->fbfd, s->fblinelength * i, SEEK_SET);
+				write(s->fbfd, (int32_t *) (s->buf + s->linelength * i), s->linelength);
 			}
 			break;
 		case FB_ROTATE_CCW:
-			for (int i = 0; i < width; i++) {
-				lseek(fbfd, fblinelength * i + (fbwidth - height * 5) * 4, SEEK_SET);
-				write(fbfd, (int32_t *) (buf + linelength * i), linelength);
+			for (int i = 0; i < s->width; i++) {
+				lseek(s->fbfd, s->fblinelength * i + (s->fbwidth - s->depth) * 4, SEEK_SET);
+				write(s->fbfd, (int32_t *) (s->buf + s->linelength * i), s->linelength);
 			}
 			break;
 	}
 }
 
 /*
- * Waits for a relevant input event. Returns 0 if touched, 1 if released.
+ * Returns the framebuffer offset of line i of the keyboard buffer.
  */
-int check_input_events(int fdinput, int *x, int *y)
-{
-	int released = 0;
-	int key = 1;
-	int absolute_x = -1, absolute_y = -1;
-	while (!done && !released && (absolute_x == -1 || absolute_y == -1))
-		while (read(fdinput, &ie, sizeof(struct input_event))
-		       && !(ie.type == EV_SYN && ie.code == SYN_REPORT)) {
-			if (ie.type == EV_ABS) {
-				switch (ie.code) {
-					case ABS_MT_POSITION_X:
-						absolute_x = ie.value;
-						released = 0;
-						key = 0;
-						break;
-					case ABS_MT_POSITION_Y:
-						absolute_y = ie.value;
-						released = 0;
-						key = 0;
-						break;
-					case ABS_MT_TRACKING_ID:
-						if (ie.value == -1) {
-							released = 1;
-						}
-						break;
-				}
+off_t line_offset(struct seat *s, int i)
+{
+	switch (s->rotate) {
+		case FB_ROTATE_UR:
+			return (off_t) s->fblinelength * (s->fbheight - s->depth + i);
+		case FB_ROTATE_CCW:
+			return (off_t) s->fblinelength * i + (s->fbwidth - s->depth) * 4;
+	}
+	return (off_t) s->fblinelength * i;
+}
+
+typedef uint8_t v16u8 __attribute__ ((vector_size(16)));
+typedef uint16_t v16u16 __attribute__ ((vector_size(32)));
+typedef uint32_t v4u32 __attribute__ ((vector_size(16)));
+
+uint32_t blend_pixel(uint32_t bg, uint32_t kb)
+{
+	uint32_t a = kb >> 24, r = bg & 0xff000000, c;
+	int i;
+	for (i = 0; i < 24; i += 8) {
+		c = ((bg >> i) & 0xff) * (255 - a) + ((kb >> i) & 0xff) * a + 128;
+		r |= ((c + (c >> 8)) >> 8) << i;
+	}
+	return r;
+}
+
+/*
+ * Blends n keyboard pixels over the background by the opacity in their
+ * top byte, four pixels at a time. The top byte of the background is
+ * kept, so reading the result back from the framebuffer matches out.
+ */
+void blend_pixels(uint32_t *out, uint32_t *bg, uint32_t *kb, int n)
+{
+	const v16u8 alpha = { 3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15 };
+	const v4u32 rgb = { 0xffffff, 0xffffff, 0xffffff, 0xffffff };
+	v16u8 b, k;
+	v16u16 bw, kw, aw, c;
+	v4u32 r, b32;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		memcpy(&b, bg + i, sizeof(b));
+		memcpy(&k, kb + i, sizeof(k));
+		bw = __builtin_convertvector(b, v16u16);
+		kw = __builtin_convertvector(k, v16u16);
+		aw = __builtin_convertvector(__builtin_shuffle(k, alpha), v16u16);
+		c = bw * (255 - aw) + kw * aw + 128;
+		c = (c + (c >> 8)) >> 8;
+		r = (v4u32) __builtin_convertvector(c, v16u8);
+		b32 = (v4u32) b;
+		r = (r & rgb) | (b32 & ~rgb);
+		memcpy(out + i, &r, sizeof(r));
+	}
+	for (; i < n; i++)
+		out[i] = blend_pixel(bg[i], kb[i]);
+}
+
+/*
+ * Blends the parts of the keyboard that changed since the last call
+ * over the cached background and writes them to the framebuffer.
+ */
+void show_overlay(struct seat *s)
+{
+	int i, lo, hi, n = s->linelength / 4;
+	uint32_t *kb, *shown, *out;
+
+	for (i = 0; i < s->buflines; i++) {
+		kb = (uint32_t *) (s->buf + s->linelength * i);
+		shown = (uint32_t *) (s->shown + s->linelength * i);
+		out = (uint32_t *) (s->out + s->linelength * i);
+		if (!memcmp(kb, shown, s->linelength))
+			continue;
+		for (lo = 0; kb[lo] == shown[lo]; lo++);
+		for (hi = n; kb[hi - 1] == shown[hi - 1]; hi--);
+		blend_pixels(out + lo, (uint32_t *) (s->bg + s->linelength * i) + lo,
+			     kb + lo, hi - lo);
+		memcpy(shown + lo, kb + lo, (hi - lo) * 4);
+		if (pwrite(s->fbfd, out + lo, (hi - lo) * 4,
+			   line_offset(s, i) + lo * 4) == -1)
+			perror("error: writing overlay");
+	}
+}
+
+/*
+ * Reads back the pixels lo to hi of line i of the overlay. Pixels that
+ * differ from what was written there were drawn by the console since:
+ * they become the new background and the keyboard is blended over them
+ * again.
+ */
+void repair_overlay(struct seat *s, int i, int lo, int hi)
+{
+	uint32_t *line = (uint32_t *) s->line, *bg, *out;
+	int j, l, h;
+
+	if (pread(s->fbfd, line + lo, (hi - lo) * 4,
+		  line_offset(s, i) + lo * 4) != (hi - lo) * 4)
+		return;
+	out = (uint32_t *) (s->out + s->linelength * i);
+	bg = (uint32_t *) (s->bg + s->linelength * i);
+	l = hi;
+	h = lo;
+	for (j = lo; j < hi; j++)
+		if (line[j] != out[j]) {
+			bg[j] = line[j];
+			if (l > j)
+				l = j;
+			h = j + 1;
+		}
+	if (l >= h)
+		return;
+	blend_pixels(out + l, bg + l,
+		     (uint32_t *) (s->shown + s->linelength * i) + l, h - l);
+	if (pwrite(s->fbfd, out + l, (h - l) * 4,
+		   line_offset(s, i) + l * 4) == -1)
+		perror("error: writing overlay");
+}
+
+void repair_keyboard(struct seat *s, int i, int lo, int hi)
+{
+	if (pwrite(s->fbfd, s->buf + s->linelength * i + lo * 4, (hi - lo) * 4,
+		   line_offset(s, i) + lo * 4) == -1)
+		perror("error: repainting keyboard");
+}
+
+/*
+ * Looks for tiles of the keyboard that the console has drawn over, in
+ * the next slice of bands of TILE_LINES lines, and repairs only those.
+ * Reading back the framebuffer is slow, so only every WATCH_STRIDE'th
+ * line of a band is compared with what was written there, a different
+ * one on every pass.
+ */
+void watch_keyboard(struct seat *s)
+{
+	int bands = (s->buflines + TILE_LINES - 1) / TILE_LINES;
+	int n = s->linelength / 4, tiles = (n + TILE_PIXELS - 1) / TILE_PIXELS;
+	int b, i, k, t, lo, hi, first, last;
+	uint32_t *line = (uint32_t *) s->line, *expected;
+
+	for (k = (bands + WATCH_SLICES - 1) / WATCH_SLICES; k > 0; k--) {
+		b = s->watchband;
+		if (++s->watchband == bands) {
+			s->watchband = 0;
+			s->watchphase = (s->watchphase + 1) % WATCH_STRIDE;
+		}
+		first = b * TILE_LINES;
+		last = first + TILE_LINES < s->buflines ? first + TILE_LINES : s->buflines;
+		memset(s->damaged, 0, tiles);
+		for (i = first + s->watchphase; i < last; i += WATCH_STRIDE) {
+			if (pread(s->fbfd, line, s->linelength, line_offset(s, i)) != s->linelength)
+				continue;
+			expected = (uint32_t *) ((overlay ? s->out : s->buf) + s->linelength * i);
+			for (t = 0; t < tiles; t++) {
+				lo = t * TILE_PIXELS;
+				hi = lo + TILE_PIXELS < n ? lo + TILE_PIXELS : n;
+				if (memcmp(line + lo, expected + lo, (hi - lo) * 4))
+					s->damaged[t] = 1;
 			}
-			if (ie.type == EV_SYN && ie.code == SYN_MT_REPORT && key) {
-				released = 1;
+		}
+		for (t = 0; t < tiles; t++) {
+			if (!s->damaged[t])
+				continue;
+			lo = t * TILE_PIXELS;
+			hi = lo + TILE_PIXELS < n ? lo + TILE_PIXELS : n;
+			for (i = first; i < last; i++)
+				if (overlay)
+					repair_overlay(s, i, lo, hi);
+				else
+					repair_keyboard(s, i, lo, hi);
+		}
+	}
+}
+
+/*
+ * Takes the initial background from the framebuffer. Nothing of the
+ * keyboard is shown yet, so the next show_overlay() blends all of it.
+ */
+void init_overlay(struct seat *s)
+{
+	int i;
+
+	s->bg = malloc(s->buflen);
+	s->shown = calloc(1, s->buflen);
+	s->out = malloc(s->buflen);
+	if (s->bg == NULL || s->shown == NULL || s->out == NULL) {
+		perror("malloc failed");
+		exit(-1);
+	}
+	for (i = 0; i < s->buflines; i++)
+		if (pread(s->fbfd, s->bg + s->linelength * i, s->linelength,
+			  line_offset(s, i)) != s->linelength) {
+			perror("error: reading framebuffer");
+			exit(-1);
+		}
+	memcpy(s->out, s->bg, s->buflen);
+}
+
+void update_keyboard(struct seat *s)
+{
+	draw_keyboard(s);
+	if (overlay)
+		show_overlay(s);
+	else
+		show_fbkeyboard(s);
+}
+
+long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Reads the pending input events of a seat. The input device does not
+ * block, a packet cut short is resumed on the next call. Returns -1 as
+ * long as no complete touch has been read, 0 if touched, 1 if released.
+ */
+int check_input_events(struct seat *s, int *x, int *y)
+{
+	struct input_event ie;
+	int released, synced = 0;
+	while (read(s->fdinput, &ie, sizeof(struct input_event)) == sizeof(struct input_event)) {
+		if (ie.type == EV_SYN && ie.code == SYN_REPORT) {
+			synced = 1;
+			break;
+		}
+		if (ie.type == EV_SYN && ie.code == SYN_DROPPED) {
+			// events were lost, start over with the next packet
+			s->absolute_x = -1;
+			s->absolute_y = -1;
+			s->released = 0;
+			s->key = 1;
+		}
+		if (ie.type == EV_ABS) {
+			switch (ie.code) {
+				case ABS_MT_POSITION_X:
+					s->absolute_x = ie.value;
+					s->released = 0;
+					s->key = 0;
+					break;
+				case ABS_MT_POSITION_Y:
+					s->absolute_y = ie.value;
+					s->released = 0;
+					s->key = 0;
+					break;
+				case ABS_MT_TRACKING_ID:
+					if (ie.value == -1) {
+						s->released = 1;
+					}
+					break;
 			}
 		}
-	switch (rotate) {
+		if (ie.type == EV_SYN && ie.code == SYN_MT_REPORT && s->key) {
+			s->released = 1;
+		}
+	}
+	if (!synced || (!s->released && (s->absolute_x == -1 || s->absolute_y == -1)))
+		return -1;
+	switch (s->rotate) {
 		case FB_ROTATE_UR:
-			*x = absolute_x * 0x10000 / twidth;
-			*y = absolute_y * 0x10000 / theight;
+			*x = s->absolute_x * 0x10000 / s->twidth;
+			*y = s->absolute_y * 0x10000 / s->theight;
 			break;
 		case FB_ROTATE_UD:
-			*x = 0x10000 - absolute_x * 0x10000 / twidth;
-			*y = 0x10000 - absolute_y * 0x10000 / theight;
+			*x = 0x10000 - s->absolute_x * 0x10000 / s->twidth;
+			*y = 0x10000 - s->absolute_y * 0x10000 / s->theight;
 			break;
 		case FB_ROTATE_CW:
-			*x = absolute_y * 0x10000 / theight;
-			*y = 0x10000 - absolute_x * 0x10000 / twidth;
+			*x = s->absolute_y * 0x10000 / s->theight;
+			*y = 0x10000 - s->absolute_x * 0x10000 / s->twidth;
 			break;
 		case FB_ROTATE_CCW:
-			*x = 0x10000 - absolute_y * 0x10000 / theight;
-			*y = absolute_x * 0x10000 / twidth;
+			*x = 0x10000 - s->absolute_y * 0x10000 / s->theight;
+			*y = s->absolute_x * 0x10000 / s->twidth;
 			break;
 	}
+	released = s->released;
+	s->absolute_x = -1;
+	s->absolute_y = -1;
+	s->released = 0;
+	s->key = 1;
 	return released;
 }
 
 /*
  * x, y and trowh are scaled to 2^16 (e.g. min x = 0, max x = 65535)
  */
-void identify_touched_key(int x, int y, int *row, int *pressed)
+void identify_touched_key(int x, int y, int trowh, int *row, int *pressed)
 {
 	switch ((0x10000 - y) / trowh) {
 		case 4:
@@ -432,8 +851,25 @@ void identify_touched_key(int x, int y, int *row, int *pressed)
 	}
 }
 
-void send_key(__u16 code)
+/*
+ * Whether a touch at x, y (scaled like in identify_touched_key) hits
+ * the overlay handle, at the bottom of the screen while the overlay is
+ * folded away and on top of the keys otherwise.
+ */
+int touches_handle(struct seat *s, int x, int y)
+{
+	if (!overlay || x < 0x10000 * 17 / 20)
+		return 0;
+	if (s->hidden)
+		return y >= 0x10000 - s->thandleh;
+	return y < 0x10000 - s->trowh * 5
+	    && y >= 0x10000 - s->trowh * 5 - s->thandleh;
+}
+
+void send_key(int fduinput, __u16 code)
 {
+	struct input_event ie;
+	memset(&ie, 0, sizeof(ie));
 	ie.type = EV_KEY;
 	ie.code = code;
 	ie.value = 1;
@@ -451,49 +887,65 @@ void send_key(__u16 code)
 		fprintf(stderr, "error: sending uinput event\n");
 }
 
-void send_uinput_event(int row, int pressed)
+void send_modifier(int fduinput, __u16 code, int *held, int value)
+{
+	struct input_event ie;
+
+	if (*held == value)
+		return;
+	memset(&ie, 0, sizeof(ie));
+	ie.type = EV_KEY;
+	ie.code = code;
+	ie.value = value;
+	if (write(fduinput, &ie, sizeof(ie)) !=
+	    sizeof(ie))
+		fprintf(stderr,
+			"error sending uinput event\n");
+	*held = value;
+}
+
+/*
+ * Holds down the modifiers locked on this seat and releases the ones
+ * another seat sharing the uinput device has locked.
+ */
+void sync_modifiers(struct seat *s)
+{
+	struct uinputdev *u = s->uinput;
+
+	send_modifier(u->fd, KEY_LEFTSHIFT, &u->shift, s->layoutuse & 1);
+	send_modifier(u->fd, KEY_LEFTALT, &u->alt, s->altlock);
+	send_modifier(u->fd, KEY_RIGHTCTRL, &u->ctrl, s->ctrllock);
+}
+
+void send_uinput_event(struct seat *s, int row, int pressed)
 {
 	if (pressed == 99)	// second page
-		layoutuse ^= 2;
+		s->layoutuse ^= 2;
+	else if (pressed == 98)	// overlay handle
+		s->hidden ^= 1;
 	else if (row == 1) {	// normal keys (abc, 123, !@#)
-		send_key(keys[row + (layoutuse >> 1)]
+		sync_modifiers(s);
+		send_key(s->uinput->fd, keys[row + (s->layoutuse >> 1)]
 			 [pressed]);
 	} else if (row == 3 && pressed == 0) {	// Left Shift
-		layoutuse ^= 1;
-		ie.type = EV_KEY;
-		ie.code = KEY_LEFTSHIFT;
-		ie.value = layoutuse & 1;
-		if (write(fduinput, &ie, sizeof(ie)) !=
-		    sizeof(ie))
-			fprintf(stderr,
-				"error sending uinput event\n");
+		s->layoutuse ^= 1;
+		sync_modifiers(s);
 	} else if (row == 4 && pressed == 0) {	// Left Alt
-		altlock ^= 1;
-		ie.type = EV_KEY;
-		ie.code = KEY_LEFTALT;
-		ie.value = altlock;
-		if (write(fduinput, &ie, sizeof(ie)) !=
-		    sizeof(ie))
-			fprintf(stderr,
-				"error sending uinput event\n");
+		s->altlock ^= 1;
+		sync_modifiers(s);
 	} else if (row == 4 && pressed == 2) {	// Right Ctrl
-		ctrllock ^= 1;
-		ie.type = EV_KEY;
-		ie.code = KEY_RIGHTCTRL;
-		ie.value = ctrllock;
-		if (write(fduinput, &ie, sizeof(ie)) !=
-		    sizeof(ie))
-			fprintf(stderr,
-				"error sending uinput event\n");
+		s->ctrllock ^= 1;
+		sync_modifiers(s);
 	} else {
-		send_key(keys[row][pressed]);
+		sync_modifiers(s);
+		send_key(s->uinput->fd, keys[row][pressed]);
 	}
 }
 
 /*
  * return max of rows
  */
-int reset_window_size(int fd)
+int reset_window_size(int fd, int landscape)
 {
 	struct winsize win = { 0, 0, 0, 0 };
 
@@ -518,12 +970,12 @@ int reset_window_size(int fd)
 	return win.ws_row;
 }
 
-void set_window_size(int fd)
+void set_window_size(int fd, int landscape)
 {
 	struct winsize win = { 0, 0, 0, 0 };
 	int rows;
 
-	rows = reset_window_size(fd);
+	rows = reset_window_size(fd, landscape);
 	if (ioctl(fd, TIOCGWINSZ, &win)) {
 		if (errno != EINVAL)
 			goto bail;
@@ -542,145 +994,304 @@ void term(int signum)
 	done = 1;
 }
 
-int main(int argc, char *argv[])
+void add_seat(char *fbdev, char *inputdev, int rotation)
 {
-	char *p = NULL;
-	int fbfd, fdinput, fdcons;
-	int tty = 0;
-	int resized[MAX_NR_CONSOLES + 1];
-	struct input_absinfo abs_x, abs_y;
-	FT_Library library;
-	int x, y, row, pressed = -1, released, key;
-
-	struct sigaction action;
-	struct vt_stat ttyinfo;
-
-	memset(&resized, 0, sizeof(resized));
+	struct seat *s;
 
-	fdcons = open("/dev/tty0", O_RDWR | O_NOCTTY);
-	if (fdcons < 0) {
-		perror("Error opening /dev/tty0");
+	seats = realloc(seats, (nseats + 1) * sizeof(struct seat));
+	if (seats == NULL) {
+		perror("malloc failed");
 		exit(-1);
 	}
+	s = &seats[nseats++];
+	memset(s, 0, sizeof(*s));
+	s->fbdev = fbdev;
+	s->inputdev = inputdev;
+	s->rotate = rotation;
+	s->fdinput = -1;
+	s->absolute_x = -1;
+	s->absolute_y = -1;
+	s->key = 1;
+	s->pressed = -1;
+}
 
-	memset(&action, 0, sizeof(action));
-	action.sa_handler = term;
-	sigaction(SIGTERM, &action, NULL);
-	sigaction(SIGINT, &action, NULL);
+/*
+ * Reads the seat configuration. Every line describes one seat by its
+ * framebuffer device, its input device and an optional rotation.
+ * Empty lines and lines starting with '#' are ignored.
+ */
+void read_config(char *path)
+{
+	FILE *f;
+	char line[512], fbdev[256], inputdev[256];
+	char *p;
+	int lineno = 0, rotation;
 
-	char c;
-	while ((c = getopt(argc, argv, "d:f:r:h")) != (char) -1) {
-		switch (c) {
-		case 'd':
-			device = optarg;
-			break;
-		case 'f':
-			font = optarg;
-			break;
-		case 'r':
-			errno = 0;
-			rotate = strtol(optarg, &p, 10) % 4;
-			if (errno != 0 || p == optarg || p == NULL || *p != '\0') {
-				printf("Invalid numeric value for -r option\n");
-				exit(0);
-			}
-			break;
-		case 'h':
-			printf("usage: %s [options]\npossible options are:\n -h: print this help\n -d: set path to inputdevice\n -f: set path to font\n -r: set rotation\n",
-			     argv[0]);
-			exit(0);
-			break;
-		case '?':
-			fprintf(stderr, "unrecognized option -%c\n",
-				optopt);
-			break;
+	f = fopen(path, "r");
+	if (f == NULL) {
+		perror("error: opening seat configuration");
+		exit(-1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		p = line + strspn(line, " \t");
+		if (*p == '#' || *p == '\n' || *p == '\0')
+			continue;
+		rotation = 0;
+		if (sscanf(p, "%255s %255s %d", fbdev, inputdev, &rotation) < 2) {
+			fprintf(stderr, "%s:%d: expected framebuffer and input device\n",
+				path, lineno);
+			exit(-1);
 		}
+		if (rotation < 0 || rotation > 3) {
+			fprintf(stderr, "%s:%d: rotation has to be between 0 and 3\n",
+				path, lineno);
+			exit(-1);
+		}
+		add_seat(strdup(fbdev), strdup(inputdev), rotation);
+	}
+	fclose(f);
+	if (nseats == 0) {
+		fprintf(stderr, "%s: no seats configured\n", path);
+		exit(-1);
 	}
+}
 
-	fbfd = open("/dev/fb0", O_RDWR);
-	if (fbfd == -1) {
-		perror("error: opening framebuffer device /dev/fb0");
+void open_framebuffer(struct seat *s)
+{
+	s->fbfd = open(s->fbdev, O_RDWR);
+	if (s->fbfd == -1) {
+		fprintf(stderr, "error: opening framebuffer device %s: %s\n",
+			s->fbdev, strerror(errno));
 		exit(-1);
 	}
-	if (ioctl(fbfd, FBIOGET_FSCREENINFO, &finfo) == -1) {
+	if (ioctl(s->fbfd, FBIOGET_FSCREENINFO, &s->finfo) == -1) {
 		perror("error: reading fixed framebuffer information");
 		exit(-1);
 	}
-	if (ioctl(fbfd, FBIOGET_VSCREENINFO, &vinfo) == -1) {
+	if (ioctl(s->fbfd, FBIOGET_VSCREENINFO, &s->vinfo) == -1) {
 		perror("error: reading variable framebuffer information");
 		exit(-1);
 	}
-	fbwidth = vinfo.xres;
-	fbheight = vinfo.yres;
-	fblinelength = finfo.line_length;
-	switch (rotate) {
+	s->fbwidth = s->vinfo.xres;
+	s->fbheight = s->vinfo.yres;
+	s->fblinelength = s->finfo.line_length;
+	switch (s->rotate) {
 		case FB_ROTATE_UR:
 		case FB_ROTATE_UD:
-			landscape = fbheight < fbwidth;
-			width = fbwidth;
-			height = fbheight / (landscape ? 2 : 3) / 5;	// height of one row
-			trowh = height * 0x10000 / fbheight;
-			linelength = fblinelength;
-			buflen = linelength * (height * 5 + 1);
+			s->landscape = s->fbheight < s->fbwidth;
+			s->width = s->fbwidth;
+			s->height = s->fbheight / (s->landscape ? 2 : 3) / 5;	// height of one row
+			s->handleh = overlay ? s->height / 3 : 0;
+			s->depth = s->height * 5 + s->handleh;
+			s->trowh = s->height * 0x10000 / s->fbheight;
+			s->thandleh = s->handleh * 0x10000 / s->fbheight;
+			s->linelength = s->fblinelength;
+			s->buflines = s->depth;
+			s->buflen = s->linelength * (s->depth + 1);
 			break;
 		case FB_ROTATE_CW:
 		case FB_ROTATE_CCW:
-			landscape = fbheight > fbwidth;
-			width = fbheight;
-			height = fbwidth / (landscape ? 2 : 3) / 5;	// height of one row
-			trowh = height * 0x10000 / fbwidth;
-			linelength = height * 5 * 4;
-			buflen = width * 4 * (height * 5 + 1);
+			s->landscape = s->fbheight > s->fbwidth;
+			s->width = s->fbheight;
+			s->height = s->fbwidth / (s->landscape ? 2 : 3) / 5;	// height of one row
+			s->handleh = overlay ? s->height / 3 : 0;
+			s->depth = s->height * 5 + s->handleh;
+			s->trowh = s->height * 0x10000 / s->fbwidth;
+			s->thandleh = s->handleh * 0x10000 / s->fbwidth;
+			s->linelength = s->depth * 4;
+			s->buflines = s->width;
+			s->buflen = s->width * 4 * (s->depth + 1);
 			break;
 	}
-	fprintf(stdout, "After Rotate: width=%d height=%d trowh=%d\n", width, height, trowh);
-	if (FT_Init_FreeType(&library)) {
-		perror("error: freetype initialization");
+	fprintf(stdout, "%s: After Rotate: width=%d height=%d trowh=%d\n",
+		s->fbdev, s->width, s->height, s->trowh);
+
+	s->buf = malloc(s->buflen);
+	s->line = malloc(s->linelength);
+	s->damaged = malloc(s->linelength / 4 / TILE_PIXELS + 1);
+	if (s->buf == 0 || s->line == NULL || s->damaged == NULL) {
+		perror("malloc failed");
 		exit(-1);
 	}
-	if (FT_New_Face(library, font, 0, &face)) {
-		perror("unable to load font file");
-		exit(-1);
+	s->top = s->handleh;
+	fill_rect(s, 0, 0, s->width - 1, s->depth, TERMCOLOR);
+	s->font = load_fontsize(s->height * 1 / 4);
+	if (overlay)
+		init_overlay(s);
+}
+
+/*
+ * Tests a bit of a sysfs bitmask like capabilities/abs, which is
+ * printed as hex longs, the most significant one first.
+ */
+int sysfs_test_bit(char *path, int bit)
+{
+	char buf[1024], *words[64], *p;
+	int n = 0, w = bit / (sizeof(long) * 8);
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+		return 0;
+	p = fgets(buf, sizeof(buf), f);
+	fclose(f);
+	if (p == NULL)
+		return 0;
+	for (p = strtok(buf, " \n"); p && n < 64; p = strtok(NULL, " \n"))
+		words[n++] = p;
+	if (w >= n)
+		return 0;
+	return strtoul(words[n - 1 - w], NULL, 16) >> (bit % (sizeof(long) * 8)) & 1;
+}
+
+/*
+ * Finds the touchscreen in sysfs without opening any device. It has to
+ * report multitouch positions; direct input devices (touchscreens) rank
+ * above pointers (touchpads), then the lowest event number wins.
+ * Returns NULL if sysfs has no such device, otherwise stores the rank
+ * of the device in score.
+ */
+char *find_touchscreen(int *score)
+{
+	static char best[32];
+	char path[300];
+	DIR *inputdevs;
+	struct dirent *dptr;
+	int n, bestn = 0, rank, bestscore = 0;
+
+	inputdevs = opendir("/sys/class/input");
+	if (inputdevs == NULL)
+		return NULL;
+	while ((dptr = readdir(inputdevs))) {
+		if (sscanf(dptr->d_name, "event%d", &n) != 1)
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/input/%s/device/capabilities/abs",
+			 dptr->d_name);
+		if (!sysfs_test_bit(path, ABS_MT_POSITION_X)
+		    || !sysfs_test_bit(path, ABS_MT_POSITION_Y))
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/input/%s/device/properties",
+			 dptr->d_name);
+		rank = 1;
+		if (sysfs_test_bit(path, INPUT_PROP_DIRECT))
+			rank += 2;
+		if (!sysfs_test_bit(path, INPUT_PROP_POINTER))
+			rank += 1;
+		if (rank > bestscore || (rank == bestscore && n < bestn)) {
+			bestscore = rank;
+			bestn = n;
+		}
 	}
-	if (FT_Set_Pixel_Sizes(face, height * 1 / 4, height * 1 / 4)) {
-		perror("FT_Set_Pixel_Sizes failed");
-		exit(-1);
+	closedir(inputdevs);
+	if (bestscore == 0)
+		return NULL;
+	*score = bestscore;
+	snprintf(best, sizeof(best), "/dev/input/event%d", bestn);
+	return best;
+}
+
+/*
+ * Without sysfs, falls back to opening every node in /dev/input and
+ * taking the first one with absolute axes.
+ */
+int scan_input_devices(void)
+{
+	DIR *inputdevs = opendir("/dev/input");
+	struct dirent *dptr;
+	int fdinput = -1, key;
+
+	if (inputdevs == NULL)
+		return -1;
+	while ((dptr = readdir(inputdevs))) {
+		if ((fdinput =
+		     openat(dirfd(inputdevs), dptr->d_name,
+			    O_RDONLY | O_NONBLOCK)) != -1
+		    && ioctl(fdinput, EVIOCGBIT(0, sizeof(key)),
+			     &key) != -1 && key >> EV_ABS & 1)
+			break;
+		if (fdinput != -1) {
+			close(fdinput);
+			fdinput = -1;
+		}
 	}
+	closedir(inputdevs);
+	return fdinput;
+}
 
-	if (device) {
-		if ((fdinput = open(device, O_RDONLY)) == -1) {
-			perror("failed to open input device node");
-			exit(-1);
+/*
+ * Opens the input device of a seat and reads the touchscreen size.
+ * Once a touchscreen has been found without -d, only devices ranking
+ * at least as high are taken when reattaching, so that a touchpad does
+ * not replace the panel while it is unplugged.
+ * Returns -1 if it is not available (yet), the reason is only printed
+ * if verbose is set.
+ */
+int attach_input(struct seat *s, int verbose)
+{
+	struct input_absinfo abs_x, abs_y;
+	char *path = s->inputdev;
+	int score = 0;
+
+	if (path == NULL && access("/sys/class/input", F_OK) == -1) {
+		s->fdinput = scan_input_devices();
+		if (s->fdinput == -1) {
+			if (verbose)
+				fprintf(stderr,
+					"no absolute axes device found in /dev/input\n");
+			return -1;
 		}
+		path = "/dev/input";
 	} else {
-		DIR *inputdevs = opendir("/dev/input");
-		struct dirent *dptr;
-		fdinput = -1;
-		while ((dptr = readdir(inputdevs))) {
-			if ((fdinput =
-			     openat(dirfd(inputdevs), dptr->d_name,
-				    O_RDONLY)) != -1
-			    && ioctl(fdinput, EVIOCGBIT(0, sizeof(key)),
-				     &key) != -1 && key >> EV_ABS & 1)
-				break;
-			if (fdinput != -1) {
-				close(fdinput);
-				fdinput = -1;
+		if (path == NULL) {
+			path = find_touchscreen(&score);
+			if (path == NULL || score < s->tscore) {
+				if (verbose)
+					fprintf(stderr,
+						"no multitouch device found in /sys/class/input\n");
+				return -1;
 			}
 		}
-		if (fdinput == -1) {
-			fprintf(stderr,
-				"no absolute axes device found in /dev/input\n");
-			exit(-1);
+		if ((s->fdinput = open(path, O_RDONLY | O_NONBLOCK)) == -1) {
+			if (verbose)
+				fprintf(stderr, "failed to open input device node %s: %s\n",
+					path, strerror(errno));
+			return -1;
 		}
 	}
-	if ((ioctl(fdinput, EVIOCGABS(ABS_MT_POSITION_X), &abs_x) == -1) ||
-	    (ioctl(fdinput, EVIOCGABS(ABS_MT_POSITION_Y), &abs_y) == -1)) {
-		perror("error: getting touchscreen size");
-		exit(-1);
+	if ((ioctl(s->fdinput, EVIOCGABS(ABS_MT_POSITION_X), &abs_x) == -1) ||
+	    (ioctl(s->fdinput, EVIOCGABS(ABS_MT_POSITION_Y), &abs_y) == -1)) {
+		if (verbose)
+			perror("error: getting touchscreen size");
+		close(s->fdinput);
+		s->fdinput = -1;
+		return -1;
 	}
-	twidth = abs_x.maximum;
-	theight = abs_y.maximum;
+	s->twidth = abs_x.maximum;
+	s->theight = abs_y.maximum;
+	if (score > s->tscore)
+		s->tscore = score;
+	s->absolute_x = -1;
+	s->absolute_y = -1;
+	s->released = 0;
+	s->key = 1;
+	fprintf(stdout, "%s: using input device %s\n", s->fbdev, path);
+	return 0;
+}
+
+void detach_input(struct seat *s)
+{
+	fprintf(stderr, "%s: input device lost, waiting for it to come back\n",
+		s->fbdev);
+	close(s->fdinput);
+	s->fdinput = -1;
+	s->pressed = -1;
+}
+
+struct uinputdev *open_uinput(void)
+{
+	struct uinputdev *u;
+	int fduinput, row, key;
 
 	fduinput = open("/dev/uinput", O_WRONLY);
 	if (fduinput == -1) {
@@ -696,7 +1307,7 @@ int main(int argc, char *argv[])
 		exit(-1);
 	}
 	for (row = 0; row < 6; row++)
-		for (key = 0; key < sizeof(keys[row]); key++)
+		for (key = 0; key < sizeof(keys[row]) / sizeof(keys[row][0]); key++)
 			ioctl(fduinput, UI_SET_KEYBIT, keys[row][key]);
 	struct uinput_user_dev uidev;
 	memset(&uidev, 0, sizeof(uidev));
@@ -713,14 +1324,129 @@ int main(int argc, char *argv[])
 		perror("error creating uinput dev");
 		exit(-1);
 	}
-
-	buf = malloc(buflen);
-	if (buf == 0) {
+	u = calloc(1, sizeof(*u));
+	if (u == NULL) {
 		perror("malloc failed");
 		exit(-1);
 	}
-	fill_rect(0, 0, width - 1, height * 5, TERMCOLOR);
+	u->fd = fduinput;
+	return u;
+}
+
+int main(int argc, char *argv[])
+{
+	char *p = NULL;
+	int fdcons;
+	int tty = 0;
+	int resized[MAX_NR_CONSOLES + 1];
+	int x, y, released, i;
+	int fdnotify;
+	long now, watch;
+	struct seat *s;
+	struct pollfd *pfds;
+
+	struct sigaction action;
+	struct vt_stat ttyinfo;
+
+	memset(&resized, 0, sizeof(resized));
+
+	fdcons = open("/dev/tty0", O_RDWR | O_NOCTTY);
+	if (fdcons < 0) {
+		perror("Error opening /dev/tty0");
+		exit(-1);
+	}
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = term;
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+
+	char c;
+	while ((c = getopt(argc, argv, "c:d:f:or:uh")) != (char) -1) {
+		switch (c) {
+		case 'c':
+			config = optarg;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		case 'f':
+#ifdef NO_FREETYPE
+			fprintf(stderr, "built without FreeType, -f is not supported\n");
+			exit(-1);
+#endif
+			font = optarg;
+			break;
+		case 'o':
+			overlay = 1;
+			break;
+		case 'r':
+			errno = 0;
+			rotate = strtol(optarg, &p, 10) % 4;
+			if (errno != 0 || p == optarg || p == NULL || *p != '\0') {
+				printf("Invalid numeric value for -r option\n");
+				exit(0);
+			}
+			break;
+		case 'u':
+			privateuinput = 1;
+			break;
+		case 'h':
+			printf("usage: %s [options]\npossible options are:\n -h: print this help\n -c: set path to seat configuration\n -d: set path to inputdevice\n -f: set path to font\n -o: overlay the console instead of shrinking it\n -r: set rotation\n -u: create one uinput device per seat\n",
+			     argv[0]);
+			exit(0);
+			break;
+		case '?':
+			fprintf(stderr, "unrecognized option -%c\n",
+				optopt);
+			break;
+		}
+	}
 
+	if (config)
+		read_config(config);
+	else
+		add_seat("/dev/fb0", device, rotate);
+
+#ifndef NO_FREETYPE
+	if (font) {
+		if (FT_Init_FreeType(&library)) {
+			perror("error: freetype initialization");
+			exit(-1);
+		}
+		if (FT_New_Face(library, font, 0, &face)) {
+			perror("unable to load font file");
+			exit(-1);
+		}
+	}
+#endif
+
+	// the last entry watches /dev/input for devices coming back
+	pfds = calloc(nseats + 1, sizeof(struct pollfd));
+	if (pfds == NULL) {
+		perror("malloc failed");
+		exit(-1);
+	}
+	for (i = 0; i < nseats; i++) {
+		s = &seats[i];
+		open_framebuffer(s);
+		if (attach_input(s, 1) == -1)
+			exit(-1);
+		if (privateuinput || i == 0)
+			s->uinput = open_uinput();
+		else
+			s->uinput = seats[0].uinput;
+		pfds[i].fd = s->fdinput;
+		pfds[i].events = POLLIN;
+		update_keyboard(s);
+	}
+	fdnotify = inotify_init1(IN_NONBLOCK);
+	if (fdnotify == -1 ||
+	    inotify_add_watch(fdnotify, "/dev/input", IN_CREATE | IN_ATTRIB) == -1)
+		perror("warning: input devices that come back will not be noticed");
+	pfds[nseats].fd = fdnotify;
+	pfds[nseats].events = POLLIN;
+	watch = now_ms() + WATCH_INTERVAL;
 
 	while (!done) {
 		if (!ioctl(fdcons, VT_GETSTATE, &ttyinfo)) {
@@ -728,29 +1454,64 @@ int main(int argc, char *argv[])
 				tty = ttyinfo.v_active;
 				close(fdcons);
 				fdcons = open("/dev/tty0", O_RDWR | O_NOCTTY);
-				set_window_size(fdcons);
-				resized[tty] = 1;
+				// the console is shown on the first seat
+				if (!overlay) {
+					set_window_size(fdcons, seats[0].landscape);
+					resized[tty] = 1;
+				}
 			}
 		} else {
 			perror("VT_GETSTATE ioctl failed");
 		}
 
-		draw_keyboard(row, pressed);
-		show_fbkeyboard(fbfd);
+		now = now_ms();
+		if (now >= watch) {
+			for (i = 0; i < nseats; i++)
+				watch_keyboard(&seats[i]);
+			watch = now + WATCH_INTERVAL;
+		}
+		if (poll(pfds, nseats + 1, watch - now) == -1) {
+			if (errno != EINTR)
+				perror("poll failed");
+			continue;
+		}
+		for (i = 0; i < nseats; i++) {
+			s = &seats[i];
+			if (pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+				// reattached once inotify reports the device back
+				detach_input(s);
+				pfds[i].fd = -1;
+				update_keyboard(s);
+				continue;
+			}
+			if (!(pfds[i].revents & POLLIN))
+				continue;
 
-		released = check_input_events(fdinput, &x, &y);
-		if (released && pressed != -1)
-			send_uinput_event(row, pressed);
+			released = check_input_events(s, &x, &y);
+			if (released == -1)
+				continue;
+			if (released && s->pressed != -1)
+				send_uinput_event(s, s->row, s->pressed);
 
-		pressed = -1;
-		if (!released) {
-			fprintf(stdout, "Touch Key identified: %d %d\n", x, y);
-			identify_touched_key(x, y, &row, &pressed);
-			fprintf(stdout, "Result ist: row=% pressed=%d\n", row, pressed);
+			s->pressed = -1;
+			if (!released && touches_handle(s, x, y)) {
+				s->pressed = 98;
+			} else if (!released && !s->hidden) {
+				fprintf(stdout, "Touch Key identified: %d %d\n", x, y);
+				identify_touched_key(x, y, s->trowh, &s->row, &s->pressed);
+				fprintf(stdout, "Result ist: row=%d pressed=%d\n", s->row, s->pressed);
+			}
+			update_keyboard(s);
+		}
+		if (pfds[nseats].revents & POLLIN) {
+			char events[4096];
+			while (read(fdnotify, events, sizeof(events)) > 0);
+			for (i = 0; i < nseats; i++)
+				if (seats[i].fdinput == -1 && attach_input(&seats[i], 0) == 0)
+					pfds[i].fd = seats[i].fdinput;
 		}
 	}
 
-	int i;
 	char buf[12];
 	for (i = 1; i <= MAX_NR_CONSOLES; i++) {
 		snprintf(buf, 12, "/dev/tty%d", i);
@@ -761,7 +1522,7 @@ int main(int argc, char *argv[])
 				perror("Error opening /dev/tty[i]");
 				exit(-1);
 			}
-			reset_window_size(fdcons);
+			reset_window_size(fdcons, seats[0].landscape);
 		}
 	}
 }
@@ -0,0 +1,100 @@
+/*
+ * mkfont.c : pre-rasterizes the fbkeyboard label glyphs into a C table
+ *
+ * Copyright 2017 Julian Winkler <julia.winkler1@web.de>
+ * Copyright 2020 Ferenc Bakonyi <bakonyi.ferenc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+/*
+ * Usage: mkfont font.ttf pixelsize... > bakedfont.h
+ *
+ * Writes the printable ASCII glyphs of the font at every given pixel
+ * size as a bakedsizes[] table of struct fontsize, see fbkeyboard.c.
+ */
+int main(int argc, char *argv[])
+{
+	FT_Library library;
+	FT_Face face;
+	FT_Bitmap *bitmap;
+	int size, c, n;
+	unsigned int i, j;
+	long offset = 0;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s font pixelsize...\n", argv[0]);
+		exit(-1);
+	}
+	if (FT_Init_FreeType(&library)) {
+		perror("error: freetype initialization");
+		exit(-1);
+	}
+	if (FT_New_Face(library, argv[1], 0, &face)) {
+		fprintf(stderr, "unable to load font file %s\n", argv[1]);
+		exit(-1);
+	}
+
+	printf("/* generated by mkfont from %s, do not edit */\n\n", argv[1]);
+	printf("const unsigned char bakedbitmaps[] = {\n");
+	for (size = 2; size < argc; size++) {
+		if (FT_Set_Pixel_Sizes(face, atoi(argv[size]), atoi(argv[size]))) {
+			fprintf(stderr, "FT_Set_Pixel_Sizes %s failed\n", argv[size]);
+			exit(-1);
+		}
+		for (c = ' '; c < 127; c++) {
+			if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+				continue;
+			bitmap = &face->glyph->bitmap;
+			n = 0;
+			for (i = 0; i < bitmap->rows; i++)
+				for (j = 0; j < bitmap->width; j++)
+					printf("%s0x%02x,", n++ % 16 ? " " : n > 1 ? "\n\t" : "\t",
+					       bitmap->buffer[bitmap->pitch * i + j]);
+			if (n)
+				printf("\n");
+		}
+	}
+	printf("};\n\n");
+
+	// the glyph cache fields (size, next) are left out on purpose
+	printf("const struct fontsize bakedsizes[] = {\n");
+	for (size = 2; size < argc; size++) {
+		FT_Set_Pixel_Sizes(face, atoi(argv[size]), atoi(argv[size]));
+		printf("\t{ .pixels = %d, .ascender = %ld, .glyphs = {\n", atoi(argv[size]),
+		       face->size->metrics.ascender >> 6);
+		for (c = ' '; c < 127; c++) {
+			if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+				continue;
+			bitmap = &face->glyph->bitmap;
+			// left, top, advance, width, rows, bitmap
+			printf("\t\t[%d] = { %d, %d, %ld, %d, %d, bakedbitmaps + %ld },\n",
+			       c, face->glyph->bitmap_left, face->glyph->bitmap_top,
+			       face->glyph->advance.x >> 6, bitmap->width,
+			       bitmap->rows, offset);
+			offset += bitmap->width * bitmap->rows;
+		}
+		printf("\t} },\n");
+	}
+	printf("};\n");
+
+	FT_Done_Face(face);
+	FT_Done_FreeType(library);
+	return 0;
+}